@@ -1,12 +1,27 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <iostream>
+#include <stdexcept>
+#include <vector>
 
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread_time.hpp>
 #include <boost/circular_buffer.hpp>
 
+// the async_ methods need C++20 coroutines
+#if defined( __cpp_impl_coroutine ) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#define MT_CIRCULAR_BUFFER_COROUTINES 1
+#endif
+
 #if 0
 #define logging std::cout
 #else
@@ -18,34 +33,438 @@
 //   return;
 #endif
 
-// Thread safe circular buffer
-class mt_circular_buffer : private boost::noncopyable
+// Thread safe pool of fixed size memory blocks
+// many mt_circular_buffers can share one pool so that idle buffers don't hold any memory
+// each thread keeps a small cache of blocks so most acquires and releases don't touch the
+// pool's lock, blocks move between a thread's cache and the pool in batches
+class mt_block_pool : private boost::noncopyable
 {
+    typedef boost::mutex::scoped_lock       scoped_lock;
+
 public:
 
-    typedef boost::shared_ptr<mt_circular_buffer> pointer;
+    typedef boost::shared_ptr<mt_block_pool> pointer;
     typedef unsigned char byte;
 
-    mt_circular_buffer( int n = 1024 )
-        : m_closed( false ), m_written( false ), m_total_read( 0 ), m_total_written( 0 )
+    // most blocks a thread keeps for itself and how many it moves to or from the pool at once
+    static const size_t thread_cache_size = 32;
+    static const size_t thread_cache_batch = 16;
+
+    // max_free is how many released blocks to keep around for reuse, the rest are deleted
+    // it includes the blocks sitting in thread caches
+    mt_block_pool( size_t block_size = 4096, size_t max_free = size_t( -1 ) )
     {
-        m_buffer.set_capacity( n );
+        if( block_size == 0 )
+        {
+            throw std::invalid_argument( "mt_block_pool block size must not be 0" );
+        }
+
+        m_state.reset( new state( block_size, max_free ) );
     }
 
-    // set the capactity of the buffer in bytes
-    void set_capacity( int capacity )
+    // get a block of block_size() bytes, reusing a released block if possible
+    byte* acquire()
     {
-        scoped_lock lock( m_monitor );
+        std::vector<byte*>& cache = _thread_cache().blocks_for( m_state );
 
-        bool growing = capacity > m_buffer.size();
+        if( cache.empty() )
+        {
+            scoped_lock lock( m_state->monitor );
+
+            size_t n = ( std::min )( size_t( thread_cache_batch ), m_state->free.size() );
+            cache.insert( cache.end(), m_state->free.end() - n, m_state->free.end() );
+            m_state->free.resize( m_state->free.size() - n );
+        }
 
-        m_buffer.set_capacity( capacity );
+        byte* block;
 
-        if( growing )
+        if( cache.empty() )
         {
-            // let any blocked writers know that they have room to write
-            m_read_event.notify_one();
+            block = new byte[ m_state->block_size ];
+            m_state->allocated++;
+        }
+        else
+        {
+            block = cache.back();
+            cache.pop_back();
+            m_state->free_count--;
+        }
+
+        size_t in_use = ++m_state->in_use;
+        size_t peak = m_state->peak_in_use;
+
+        while( in_use > peak && ! m_state->peak_in_use.compare_exchange_weak( peak, in_use ) )
+        {
+        }
+
+        return block;
+    }
+
+    // give a block from acquire() back to the pool, it can be released on any thread
+    void release( byte* block )
+    {
+        m_state->in_use--;
+
+        if( m_state->free_count >= m_state->max_free )
+        {
+            delete[] block;
+            return;
+        }
+
+        m_state->free_count++;
+
+        std::vector<byte*>& cache = _thread_cache().blocks_for( m_state );
+        cache.push_back( block );
+
+        if( cache.size() > thread_cache_size )
+        {
+            scoped_lock lock( m_state->monitor );
+
+            m_state->free.insert( m_state->free.end(), cache.end() - thread_cache_batch, cache.end() );
+            cache.resize( cache.size() - thread_cache_batch );
+        }
+    }
+
+    // size of every block in bytes
+    size_t block_size() const
+    {
+        return m_state->block_size;
+    }
+
+    // how many blocks are currently held by buffers
+    size_t blocks_in_use() const
+    {
+        return m_state->in_use;
+    }
+
+    // how many released blocks are waiting to be reused, in the pool or in thread caches
+    size_t blocks_free() const
+    {
+        return m_state->free_count;
+    }
+
+    // the most blocks that have ever been in use at once
+    size_t peak_blocks_in_use() const
+    {
+        return m_state->peak_in_use;
+    }
+
+    // how many blocks have ever been allocated, blocks that get reused aren't counted again
+    size_t blocks_allocated() const
+    {
+        return m_state->allocated;
+    }
+
+private:
+
+    // everything about the pool that a thread cache may need after the pool is gone
+    struct state : private boost::noncopyable
+    {
+        state( size_t block_size, size_t max_free )
+            : block_size( block_size ), max_free( max_free )
+            , in_use( 0 ), peak_in_use( 0 ), free_count( 0 ), allocated( 0 )
+        {
+        }
+
+        ~state()
+        {
+            for( size_t i = 0; i < free.size(); ++i )
+            {
+                delete[] free[i];
+            }
+        }
+
+        // hand blocks from a thread cache back, used when the thread exits
+        void give_back( std::vector<byte*>& blocks )
+        {
+            scoped_lock lock( monitor );
+            free.insert( free.end(), blocks.begin(), blocks.end() );
+            blocks.clear();
+        }
+
+        const size_t                block_size;
+        const size_t                max_free;
+
+        boost::mutex                monitor;
+        std::vector<byte*>          free;           // protected by monitor
+
+        std::atomic<size_t>         in_use;
+        std::atomic<size_t>         peak_in_use;
+        std::atomic<size_t>         free_count;     // blocks in free and in every thread cache
+        std::atomic<size_t>         allocated;
+    };
+
+    // the blocks one thread has cached for each pool it has used
+    class thread_cache : private boost::noncopyable
+    {
+    public:
+
+        thread_cache() {}
+
+        // the thread is exiting, give our blocks back or delete them if their pool is gone
+        ~thread_cache()
+        {
+            for( size_t i = 0; i < m_entries.size(); ++i )
+            {
+                _drop( m_entries[i] );
+            }
+        }
+
+        std::vector<byte*>& blocks_for( const boost::shared_ptr<state>& owner )
+        {
+            for( size_t i = 0; i < m_entries.size(); )
+            {
+                if( m_entries[i].owner.expired() )
+                {
+                    // the pool is gone and its address may have been reused, forget it
+                    _drop( m_entries[i] );
+                    m_entries.erase( m_entries.begin() + i );
+                }
+                else if( m_entries[i].key == owner.get() )
+                {
+                    return m_entries[i].blocks;
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+
+            m_entries.push_back( entry() );
+            m_entries.back().owner = owner;
+            m_entries.back().key = owner.get();
+            return m_entries.back().blocks;
+        }
+
+    private:
+
+        struct entry
+        {
+            boost::weak_ptr<state>      owner;
+            const state*                key;
+            std::vector<byte*>          blocks;
+        };
+
+        static void _drop( entry& e )
+        {
+            if( boost::shared_ptr<state> owner = e.owner.lock() )
+            {
+                owner->give_back( e.blocks );
+                return;
+            }
+
+            for( size_t i = 0; i < e.blocks.size(); ++i )
+            {
+                delete[] e.blocks[i];
+            }
+
+            e.blocks.clear();
+        }
+
+        std::vector<entry>              m_entries;
+    };
+
+    static thread_cache& _thread_cache()
+    {
+        static thread_local thread_cache cache;
+        return cache;
+    }
+
+    boost::shared_ptr<state>                m_state;
+};
+
+// The locking, waiting and async parts shared by the thread safe circular buffers below
+// Derived supplies the storage through storage_size(), storage_capacity(), storage_push(),
+// storage_pop() and storage_clear(), they're only ever called with the lock held
+// storage_pop() is given a null data when the bytes should just be thrown away
+template<typename Derived>
+class basic_mt_circular_buffer : private boost::noncopyable
+{
+protected:
+
+    typedef boost::mutex::scoped_lock       scoped_lock;
+
+public:
+
+    typedef unsigned char byte;
+
+private:
+
+    // a thread blocked in read() or write() and how many bytes, or free bytes, it's waiting for
+    // these live on the blocked thread's stack, the buffer keeps a list of them
+    struct threshold_node
+    {
+        size_t              threshold;
+        threshold_node*     next;
+    };
+
+    // adds a node to a list for as long as a thread is blocked, removes it even if the wait throws
+    class blocked_waiter : private boost::noncopyable
+    {
+    public:
+
+        blocked_waiter( threshold_node*& list, size_t threshold )
+            : m_list( list )
+        {
+            m_node.threshold = threshold;
+            m_node.next = m_list;
+            m_list = &m_node;
+        }
+
+        ~blocked_waiter()
+        {
+            threshold_node** link = &m_list;
+
+            while( *link != &m_node )
+            {
+                link = &( *link )->next;
+            }
+
+            *link = m_node.next;
+        }
+
+    private:
+
+        threshold_node*&    m_list;
+        threshold_node      m_node;
+    };
+
+    // an operation that is waiting on the buffer without blocking a thread
+    // these live inside the waiting coroutine's frame so waiting doesn't allocate
+    struct async_op
+    {
+        enum kind_t { reading, writing, waiting };
+
+        kind_t          kind;
+        byte*           read_data;
+        const byte*     write_data;
+        size_t          count;
+        size_t          done;
+        async_op*       next;
+        bool            queued;                     // in one of the buffer's lists, only changed with the lock held
+        void            ( *complete )( async_op* ); // called with the lock held once the operation has finished
+    };
+
+public:
+
+#ifdef MT_CIRCULAR_BUFFER_COROUTINES
+    // returned by the async_ methods, co_await it
+    // Scheduler is any callable taking a std::coroutine_handle<>, it's called when the operation
+    // completes and must queue the handle to be resumed later, it must not resume it directly
+    // because it's called with the buffer's lock held
+    template<typename Scheduler>
+    class awaitable : private async_op
+    {
+    public:
+
+        awaitable( basic_mt_circular_buffer& buffer, typename async_op::kind_t kind, byte* read_data, const byte* write_data, size_t count, Scheduler scheduler )
+            : m_owner( buffer ), m_scheduler( scheduler )
+        {
+            this->kind = kind;
+            this->read_data = read_data;
+            this->write_data = write_data;
+            this->count = count;
+            this->done = 0;
+            this->next = 0;
+            this->queued = false;
+            this->complete = &awaitable::_complete;
+        }
+
+        // a coroutine destroyed while suspended on us must not leave us in the buffer's lists
+        // queued is cleared before the scheduler gets the coroutine so a completed op doesn't touch the buffer
+        ~awaitable()
+        {
+            if( this->queued )
+            {
+                scoped_lock lock( m_owner.m_monitor );
+                m_owner._async_dequeue( this );
+            }
+        }
+
+        awaitable( const awaitable& ) = delete;
+        awaitable& operator=( const awaitable& ) = delete;
+
+        bool await_ready() const
+        {
+            return false; // we need the lock to know, so do it in await_suspend
+        }
+
+        // returns false, and so doesn't suspend, if the operation could finish right away
+        bool await_suspend( std::coroutine_handle<> handle )
+        {
+            m_handle = handle;
+
+            scoped_lock lock( m_owner.m_monitor );
+
+            if( m_owner._async_progress( this ) )
+            {
+                return false;
+            }
+
+            // others may be able to make progress now, including an async op on the other
+            // end of this one which can complete us, the scheduler will resume us in that case
+            m_owner._async_enqueue( this );
+            m_owner._pump_async();
+            return true;
+        }
+
+        // how many bytes were read or written, 0 for async_wait_for_write
+        size_t await_resume()
+        {
+            if( this->kind == async_op::writing && this->done < this->count )
+            {
+                throw std::runtime_error( "trying to write to a closed buffer" );
+            }
+
+            return this->done;
+        }
+
+    private:
+
+        static void _complete( async_op* op )
+        {
+            awaitable* self = static_cast<awaitable*>( op );
+
+            // the coroutine may be resumed, and this awaitable destroyed, before the scheduler returns
+            Scheduler scheduler = self->m_scheduler;
+            std::coroutine_handle<> handle = self->m_handle;
+
+            scheduler( handle );
         }
+
+        basic_mt_circular_buffer&   m_owner;
+        Scheduler                   m_scheduler;
+        std::coroutine_handle<>     m_handle;
+    };
+#endif
+
+    // a blocked reader is not woken until at least n bytes are buffered (or it can finish its read)
+    // a larger watermark means fewer wakeups for readers of a trickle fed buffer
+    // takes effect the next time a reader blocks
+    void set_read_watermark( size_t n )
+    {
+        scoped_lock lock( m_monitor );
+        m_read_watermark = ( std::max )( n, size_t( 1 ) );
+    }
+
+    size_t read_watermark() const
+    {
+        scoped_lock lock( m_monitor );
+        return m_read_watermark;
+    }
+
+    // a blocked writer is not woken until at least n bytes are free (or it can finish its write)
+    // takes effect the next time a writer blocks
+    void set_write_watermark( size_t n )
+    {
+        scoped_lock lock( m_monitor );
+        m_write_watermark = ( std::max )( n, size_t( 1 ) );
+    }
+
+    size_t write_watermark() const
+    {
+        scoped_lock lock( m_monitor );
+        return m_write_watermark;
     }
 
     // close the buffer to future writes
@@ -61,6 +480,8 @@ public:
 
         // wake up any reads that might be in progress so they can return
         m_write_event.notify_all();
+
+        _pump_async();
     }
 
     bool closed() const
@@ -127,9 +548,18 @@ public:
                 throw std::runtime_error( "trying to write to a closed buffer" );
             }
 
-            while( m_buffer.full() )
+            // don't wake up for every byte that gets read, wait until we can make real progress
+            for( ;; )
             {
+                size_t threshold = _write_threshold( count - bytes_written );
+
+                if( ! _full() && remaining() >= threshold )
+                {
+                    break;
+                }
+
                 logging << "writer waiting" << std::endl;
+                blocked_waiter waiter( m_blocked_writers, threshold );
                 m_read_event.wait( lock );
                 logging << "writer waking" << std::endl;
             }
@@ -151,7 +581,7 @@ public:
     }
 
     // read from the buffer, this will block until the bytes have been read or the buffer is closed
-    // this method handles all the locking
+    // this method handles all the locking, a null data throws the bytes away, see skip()
     size_t read( byte* data, size_t count )
     {
         size_t bytes_read = 0;
@@ -160,17 +590,10 @@ public:
         {
             scoped_lock lock( m_monitor );
 
-            // we may have closed and signalled m_write_event but we weren't waiting on it yet
-            // therefore, only wait if we're empty and we're not closed
-            while( m_buffer.empty() && ! m_closed )
-            {
-                logging << "reader waiting" << std::endl;
-                m_write_event.wait( lock );
-                logging << "reader waking" << std::endl;
-            }
+            _wait_for_data( lock, ( std::min )( count - bytes_read, m_read_watermark ), 0 );
 
-            size_t to_read = ( std::min )( count - bytes_read, m_buffer.size() );
-            bytes_read += _read( data + bytes_read, to_read );
+            size_t to_read = ( std::min )( count - bytes_read, _size() );
+            bytes_read += _read( data ? data + bytes_read : 0, to_read );
 
             // don't break before reading any remaining bytes
             // as the caller probably wants them
@@ -180,90 +603,432 @@ public:
         return bytes_read;
     }
 
+    // helper function so caller doesn't always have to cast
+    // caller is responsible for any and all problems from such a dangerous cast
+    template<typename T>
+    size_t read_at_least( T* data, size_t min, size_t max )
+    {
+        return read_at_least( reinterpret_cast<byte*>( data ), min, max );
+    }
+
+    // read between min and max bytes, this will block until min bytes have been read or the buffer is closed
+    // a min of 0 returns whatever is currently in the buffer without blocking
+    size_t read_at_least( byte* data, size_t min, size_t max )
+    {
+        return _read_at_least( data, min, max, 0 );
+    }
+
+    template<typename T>
+    size_t read_at_least( T* data, size_t min, size_t max, const boost::posix_time::time_duration& timeout )
+    {
+        return read_at_least( reinterpret_cast<byte*>( data ), min, max, timeout );
+    }
+
+    // as above but gives up waiting for min bytes after timeout and returns what it has, possibly 0
+    size_t read_at_least( byte* data, size_t min, size_t max, const boost::posix_time::time_duration& timeout )
+    {
+        boost::system_time deadline = boost::get_system_time() + timeout;
+        return _read_at_least( data, min, max, &deadline );
+    }
+
+#ifdef MT_CIRCULAR_BUFFER_COROUTINES
+    // co_await to read from the buffer without blocking a thread, resumes via scheduler
+    // when count bytes have been read or the buffer is closed, see awaitable for what scheduler must do
+    // the bytes are copied by whichever thread wrote them, the coroutine only resumes once it's done
+    // async operations don't use the read and write watermarks, bytes are moved as soon as they
+    // arrive, but that doesn't wake anything, the coroutine is resumed once for the whole transfer
+    template<typename T, typename Scheduler>
+    awaitable<Scheduler> async_read( T* data, size_t count, Scheduler scheduler )
+    {
+        return awaitable<Scheduler>( *this, async_op::reading, reinterpret_cast<byte*>( data ), 0, count, scheduler );
+    }
+
+    // co_await to write into the buffer without blocking a thread, resumes via scheduler
+    // when all count bytes have been written, throws if the buffer is closed first
+    template<typename T, typename Scheduler>
+    awaitable<Scheduler> async_write( const T* data, size_t count, Scheduler scheduler )
+    {
+        return awaitable<Scheduler>( *this, async_op::writing, 0, reinterpret_cast<const byte*>( data ), count, scheduler );
+    }
+
+    // co_await version of wait_for_write()
+    template<typename Scheduler>
+    awaitable<Scheduler> async_wait_for_write( Scheduler scheduler )
+    {
+        return awaitable<Scheduler>( *this, async_op::waiting, 0, 0, 0, scheduler );
+    }
+#endif
+
     // throw way the first n bytes of the buffer
+    // blocks just like read() but the bytes are dropped from the storage without being copied
     size_t skip( size_t count )
     {
-        std::vector<byte> scrach( count );
-        return read( &scrach[0], count );
+        return read( static_cast<byte*>( 0 ), count );
     }
 
     // delete contents of buffer
     void clear()
     {
         scoped_lock lock( m_monitor );
-        m_buffer.clear();
+
+        _derived().storage_clear();
+
+        // there's room for any blocked writers
+        m_read_event.notify_all();
+        _pump_async();
     }
 
     // how many bytes are currently in the buffer
     size_t size() const
     {
         scoped_lock lock( m_monitor );
-        return m_buffer.size();
+        return _size();
     }
 
     // how many bytes could the buffer hold
     size_t capacity() const
     {
         scoped_lock lock( m_monitor );
-        return m_buffer.capacity();
+        return _capacity();
     }
 
     // is the buffer empty
     bool empty() const
     {
         scoped_lock lock( m_monitor );
-        return m_buffer.empty();
+        return _empty();
     }
 
     // is the buffer full
     bool full() const
     {
         scoped_lock lock( m_monitor );
-        return m_buffer.full();
+        return _full();
     }
 
+protected:
 
-private:
+    basic_mt_circular_buffer()
+        : m_closed( false ), m_written( false ), m_total_read( 0 ), m_total_written( 0 )
+        , m_read_watermark( 1 ), m_write_watermark( 1 ), m_blocked_readers( 0 ), m_blocked_writers( 0 )
+        , m_async_readers( 0 ), m_async_writers( 0 ), m_async_waiters( 0 ), m_pumping( false ), m_pump_again( false )
+    {
+    }
+
+    // Derived's destructor must call this while its storage still exists
+    // finishes any pending async operations as if we'd been closed so their coroutines aren't lost
+    void _close_pending()
+    {
+        scoped_lock lock( m_monitor );
+        m_closed = true;
+        m_written = true;
+        _pump_async();
+    }
+
+    Derived& _derived()
+    {
+        return static_cast<Derived&>( *this );
+    }
+
+    const Derived& _derived() const
+    {
+        return static_cast<const Derived&>( *this );
+    }
 
-    // this method does the actual writing to the internal circular buffer
+    // this method does the actual writing to the storage
     size_t _write( const byte* data, size_t count )
     {
         logging <<"_write: " << count << std::endl;
 
+        bool first_write = ! m_written;
+
         m_written = true;
         m_total_written += count;
 
-        m_buffer.insert( m_buffer.end(), data, data + count );
-        m_write_event.notify_all(); // wake up any blocked readers
+        _derived().storage_push( data, count );
+
+        // wake up any blocked readers, but only if they have enough to do something useful
+        // wait_for_write only cares about the first write
+        if( first_write || _full() || _size() >= _smallest_threshold( m_blocked_readers ) )
+        {
+            m_write_event.notify_all();
+        }
+
+        _pump_async();
 
         return count;
     }
 
-    // this method does the actual reading from the internal circular buffer
+    // this method does the actual reading from the storage
     size_t _read( byte* data, size_t count )
     {
         logging << "_read: " << count << std::endl;
 
         m_total_read += count;
 
-        std::copy( m_buffer.begin(), m_buffer.begin() + count, data );
-        m_buffer.erase_begin( count );
+        _derived().storage_pop( data, count );
+
+        // wake up blocked writers if one of them has enough room to do something useful
+        // they can be waiting for different amounts so wake them all and let them sort it out
+        if( _empty() || remaining() >= _smallest_threshold( m_blocked_writers ) )
+        {
+            m_read_event.notify_all();
+        }
 
-        m_read_event.notify_one(); // wake up a blocked writer
+        _pump_async();
 
         return count;
     }
 
-    // how many bytes could we write before blocking
-    size_t remaining() const
+    // move as many bytes as possible for op, returns true when op has finished
+    bool _async_progress( async_op* op )
     {
-        return m_buffer.capacity() - m_buffer.size();
-    }
+        switch( op->kind )
+        {
+            case async_op::reading:
+            {
+                size_t to_read = ( std::min )( op->count - op->done, _size() );
 
-    friend class mt_circular_buffer_tests;
-    typedef boost::mutex::scoped_lock       scoped_lock;
+                if( to_read > 0 )
+                {
+                    op->done += _read( op->read_data + op->done, to_read );
+                }
 
-    boost::circular_buffer<byte>            m_buffer;
+                return op->done == op->count || m_closed;
+            }
+
+            case async_op::writing:
+            {
+                if( m_closed ) { return true; }
+
+                size_t to_write = ( std::min )( op->count - op->done, remaining() );
+
+                if( to_write > 0 )
+                {
+                    op->done += _write( op->write_data + op->done, to_write );
+                }
+
+                return op->done == op->count;
+            }
+
+            case async_op::waiting:
+                return m_written;
+        }
+
+        return true;
+    }
+
+    // add op to the end of the list of operations of its kind
+    void _async_enqueue( async_op* op )
+    {
+        async_op** link = op->kind == async_op::reading ? &m_async_readers
+                        : op->kind == async_op::writing ? &m_async_writers
+                        : &m_async_waiters;
+
+        while( *link )
+        {
+            link = &( *link )->next;
+        }
+
+        op->next = 0;
+        op->queued = true;
+        *link = op;
+    }
+
+    // take op out of whichever list it's in
+    void _async_dequeue( async_op* op )
+    {
+        async_op** lists[] = { &m_async_readers, &m_async_writers, &m_async_waiters };
+
+        for( size_t i = 0; i < 3; ++i )
+        {
+            for( async_op** link = lists[i]; *link; link = &( *link )->next )
+            {
+                if( *link == op )
+                {
+                    *link = op->next;
+                    op->queued = false;
+                    return;
+                }
+            }
+        }
+    }
+
+    // give every waiting async operation a chance to make progress and complete the finished ones
+    // _read and _write call this, so it guards against being re-entered through _async_progress
+    void _pump_async()
+    {
+        if( ! m_async_readers && ! m_async_writers && ! m_async_waiters )
+        {
+            return;
+        }
+
+        if( m_pumping )
+        {
+            m_pump_again = true;
+            return;
+        }
+
+        m_pumping = true;
+
+        do
+        {
+            m_pump_again = false;
+
+            async_op** lists[] = { &m_async_readers, &m_async_writers, &m_async_waiters };
+
+            for( size_t i = 0; i < 3; ++i )
+            {
+                async_op** link = lists[i];
+
+                while( *link )
+                {
+                    async_op* op = *link;
+
+                    if( _async_progress( op ) )
+                    {
+                        *link = op->next;
+                        op->queued = false;
+                        op->complete( op ); // op may be gone after this
+                    }
+                    else
+                    {
+                        link = &op->next;
+                    }
+                }
+            }
+        }
+        while( m_pump_again );
+
+        m_pumping = false;
+    }
+
+    // block until a reader needing threshold more bytes can make progress or the buffer is closed
+    // returns false if deadline passed first, a null deadline waits forever
+    bool _wait_for_data( scoped_lock& lock, size_t threshold, const boost::system_time* deadline )
+    {
+        // we may have closed and signalled m_write_event but we weren't waiting on it yet
+        // therefore, only wait if we're not closed
+        while( ! m_closed )
+        {
+            // the capacity may have shrunk while we were waiting so recalculate every time
+            size_t wanted = ( std::min )( threshold, _capacity() );
+
+            if( _size() >= wanted && ( threshold == 0 || ! _empty() ) )
+            {
+                break;
+            }
+
+            logging << "reader waiting" << std::endl;
+
+            // a blocked writer may be waiting for more room than it can get while we hold out
+            // for wanted bytes, let it recalculate its threshold now that we're waiting
+            blocked_waiter waiter( m_blocked_readers, wanted );
+            m_read_event.notify_all();
+
+            bool signalled = true;
+
+            if( ! deadline )
+            {
+                m_write_event.wait( lock );
+            }
+            else
+            {
+                signalled = m_write_event.timed_wait( lock, *deadline );
+            }
+
+            if( ! signalled )
+            {
+                logging << "reader timed out" << std::endl;
+                return false;
+            }
+
+            logging << "reader waking" << std::endl;
+        }
+
+        return true;
+    }
+
+    // how many free bytes a writer with count bytes left to write should wait for
+    // if readers are blocked too, leave the most easily satisfied one room to reach its threshold
+    // otherwise it and we could both wait forever
+    size_t _write_threshold( size_t count ) const
+    {
+        size_t limit = _capacity();
+        size_t reader = _smallest_threshold( m_blocked_readers );
+
+        if( reader < limit )
+        {
+            limit -= reader;
+        }
+        else if( m_blocked_readers )
+        {
+            limit = 1;
+        }
+
+        return ( std::min )( ( std::min )( count, m_write_watermark ), limit );
+    }
+
+    // the smallest threshold of any blocked thread in list, or size_t(-1) if there are none
+    static size_t _smallest_threshold( const threshold_node* list )
+    {
+        size_t smallest = size_t( -1 );
+
+        for( ; list; list = list->next )
+        {
+            smallest = ( std::min )( smallest, list->threshold );
+        }
+
+        return smallest;
+    }
+
+    size_t _read_at_least( byte* data, size_t min, size_t max, const boost::system_time* deadline )
+    {
+        min = ( std::min )( min, max );
+        size_t bytes_read = 0;
+
+        scoped_lock lock( m_monitor );
+
+        while( bytes_read < max )
+        {
+            // min may be larger than the capacity in which case we read a full buffer at a time
+            bool ready = _wait_for_data( lock, min - ( std::min )( min, bytes_read ), deadline );
+
+            size_t to_read = ( std::min )( max - bytes_read, _size() );
+            bytes_read += _read( data + bytes_read, to_read );
+
+            if( bytes_read >= min || m_closed || ! ready ) { break; }
+        }
+
+        return bytes_read;
+    }
+
+    // how many bytes could we write before blocking
+    size_t remaining() const
+    {
+        return _capacity() - _size();
+    }
+
+    // the following are the unlocked versions of the public methods
+    size_t _size() const
+    {
+        return _derived().storage_size();
+    }
+
+    size_t _capacity() const
+    {
+        return _derived().storage_capacity();
+    }
+
+    bool _empty() const
+    {
+        return _size() == 0;
+    }
+
+    bool _full() const
+    {
+        return _size() >= _capacity();
+    }
 
     mutable boost::mutex                    m_monitor;
     boost::condition                        m_write_event;  // a write happened
@@ -273,5 +1038,324 @@ private:
 
     size_t                                  m_total_read;
     size_t                                  m_total_written;
+
+    size_t                                  m_read_watermark;
+    size_t                                  m_write_watermark;
+    threshold_node*                         m_blocked_readers;  // what each blocked reader is waiting for
+    threshold_node*                         m_blocked_writers;  // what each blocked writer is waiting for
+
+    // async operations waiting on the buffer, see async_read()
+    async_op*                               m_async_readers;
+    async_op*                               m_async_writers;
+    async_op*                               m_async_waiters;
+    bool                                    m_pumping;
+    bool                                    m_pump_again;
+};
+
+// Thread safe circular buffer
+class mt_circular_buffer : public basic_mt_circular_buffer<mt_circular_buffer>
+{
+public:
+
+    typedef boost::shared_ptr<mt_circular_buffer> pointer;
+
+    mt_circular_buffer( int n = 1024 )
+        : m_block_offset( 0 ), m_pooled_size( 0 ), m_pooled_capacity( 0 )
+    {
+        m_buffer.set_capacity( n );
+    }
+
+    // a buffer of n bytes that doesn't allocate until it's written to
+    // storage is taken from pool a block at a time and given back as soon as it's been read
+    mt_circular_buffer( int n, mt_block_pool::pointer pool )
+        : m_pool( pool ), m_block_offset( 0 ), m_pooled_size( 0 ), m_pooled_capacity( n )
+    {
+        if( ! m_pool )
+        {
+            throw std::invalid_argument( "mt_circular_buffer needs a block pool" );
+        }
+    }
+
+    ~mt_circular_buffer()
+    {
+        _close_pending();
+        _release_blocks();
+    }
+
+    // set the capactity of the buffer in bytes
+    void set_capacity( int capacity )
+    {
+        scoped_lock lock( m_monitor );
+
+        bool growing = capacity > _size();
+
+        if( m_pool )
+        {
+            m_pooled_capacity = capacity;
+            _truncate_blocks( ( std::min )( m_pooled_size, m_pooled_capacity ) );
+        }
+        else
+        {
+            m_buffer.set_capacity( capacity );
+        }
+
+        if( growing )
+        {
+            // let any blocked writers know that they have room to write
+            m_read_event.notify_all();
+        }
+        else
+        {
+            // a blocked reader may be waiting for more bytes than will now fit
+            m_write_event.notify_all();
+        }
+
+        _pump_async();
+    }
+
+private:
+
+    friend class basic_mt_circular_buffer<mt_circular_buffer>;
+
+    // the storage interface basic_mt_circular_buffer needs
+    size_t storage_size() const
+    {
+        return m_pool ? m_pooled_size : m_buffer.size();
+    }
+
+    size_t storage_capacity() const
+    {
+        return m_pool ? m_pooled_capacity : m_buffer.capacity();
+    }
+
+    void storage_push( const byte* data, size_t count )
+    {
+        if( m_pool )
+        {
+            _write_blocks( data, count );
+        }
+        else
+        {
+            m_buffer.insert( m_buffer.end(), data, data + count );
+        }
+    }
+
+    void storage_pop( byte* data, size_t count )
+    {
+        if( m_pool )
+        {
+            _read_blocks( data, count );
+        }
+        else
+        {
+            if( data )
+            {
+                std::copy( m_buffer.begin(), m_buffer.begin() + count, data );
+            }
+
+            m_buffer.erase_begin( count );
+        }
+    }
+
+    void storage_clear()
+    {
+        if( m_pool )
+        {
+            _release_blocks();
+        }
+        else
+        {
+            m_buffer.clear();
+        }
+    }
+
+    // append to the pooled blocks, acquiring new blocks as needed
+    // count must not be larger than remaining()
+    void _write_blocks( const byte* data, size_t count )
+    {
+        const size_t block_size = m_pool->block_size();
+
+        while( count > 0 )
+        {
+            size_t end = m_block_offset + m_pooled_size;
+            size_t index = end / block_size;
+            size_t offset = end % block_size;
+
+            if( index == m_blocks.size() )
+            {
+                m_blocks.push_back( m_pool->acquire() );
+            }
+
+            size_t n = ( std::min )( count, block_size - offset );
+            std::copy( data, data + n, m_blocks[index] + offset );
+
+            data += n;
+            count -= n;
+            m_pooled_size += n;
+        }
+    }
+
+    // remove from the front of the pooled blocks, releasing blocks as they empty
+    // count must not be larger than _size(), a null data drops the bytes
+    void _read_blocks( byte* data, size_t count )
+    {
+        const size_t block_size = m_pool->block_size();
+
+        while( count > 0 )
+        {
+            size_t n = ( std::min )( count, block_size - m_block_offset );
+
+            if( data )
+            {
+                std::copy( m_blocks.front() + m_block_offset, m_blocks.front() + m_block_offset + n, data );
+                data += n;
+            }
+
+            count -= n;
+            m_pooled_size -= n;
+            m_block_offset += n;
+
+            if( m_block_offset == block_size )
+            {
+                m_pool->release( m_blocks.front() );
+                m_blocks.pop_front();
+                m_block_offset = 0;
+            }
+        }
+
+        if( m_pooled_size == 0 )
+        {
+            _release_blocks(); // a drained buffer holds no memory
+        }
+    }
+
+    // throw away everything after the first size bytes, like boost::circular_buffer::set_capacity does
+    void _truncate_blocks( size_t size )
+    {
+        if( size == 0 )
+        {
+            _release_blocks();
+            return;
+        }
+
+        const size_t block_size = m_pool->block_size();
+        size_t needed = ( m_block_offset + size + block_size - 1 ) / block_size;
+
+        while( m_blocks.size() > needed )
+        {
+            m_pool->release( m_blocks.back() );
+            m_blocks.pop_back();
+        }
+
+        m_pooled_size = size;
+    }
+
+    // give all pooled blocks back to the pool
+    void _release_blocks()
+    {
+        for( size_t i = 0; i < m_blocks.size(); ++i )
+        {
+            m_pool->release( m_blocks[i] );
+        }
+
+        m_blocks.clear();
+        m_block_offset = 0;
+        m_pooled_size = 0;
+    }
+
+    friend class mt_circular_buffer_tests;
+
+    boost::circular_buffer<byte>            m_buffer;
+
+    // only used when constructed with a pool, m_buffer is unused in that case
+    mt_block_pool::pointer                  m_pool;
+    std::deque<byte*>                       m_blocks;
+    size_t                                  m_block_offset;     // where the first unread byte is in m_blocks.front()
+    size_t                                  m_pooled_size;
+    size_t                                  m_pooled_capacity;
 };
 
+// Thread safe circular buffer with a compile time capacity
+// storage lives inside the object so construction never allocates and, because
+// N must be a power of two, wrapping an index is a mask instead of a modulo
+template<size_t N>
+class fixed_mt_circular_buffer : public basic_mt_circular_buffer< fixed_mt_circular_buffer<N> >
+{
+    static_assert( N > 0 && ( N & ( N - 1 ) ) == 0, "fixed_mt_circular_buffer capacity must be a power of two" );
+
+    typedef basic_mt_circular_buffer< fixed_mt_circular_buffer<N> > base;
+
+public:
+
+    typedef boost::shared_ptr<fixed_mt_circular_buffer> pointer;
+    typedef typename base::byte byte;
+
+    fixed_mt_circular_buffer()
+        : m_head( 0 ), m_tail( 0 )
+    {
+    }
+
+    ~fixed_mt_circular_buffer()
+    {
+        this->_close_pending();
+    }
+
+    // how many bytes could the buffer hold
+    static constexpr size_t capacity()
+    {
+        return N;
+    }
+
+private:
+
+    friend class basic_mt_circular_buffer< fixed_mt_circular_buffer<N> >;
+
+    // the storage interface basic_mt_circular_buffer needs
+    // m_head and m_tail only ever increase, unsigned wrap around keeps their difference correct
+    size_t storage_size() const
+    {
+        return m_tail - m_head;
+    }
+
+    size_t storage_capacity() const
+    {
+        return N;
+    }
+
+    // count must not be larger than the free space
+    void storage_push( const byte* data, size_t count )
+    {
+        size_t index = m_tail & ( N - 1 );
+        size_t first = ( std::min )( count, N - index );
+
+        std::copy( data, data + first, m_data + index );
+        std::copy( data + first, data + count, m_data );
+        m_tail += count;
+    }
+
+    // count must not be larger than storage_size(), a null data drops the bytes
+    void storage_pop( byte* data, size_t count )
+    {
+        if( data )
+        {
+            size_t index = m_head & ( N - 1 );
+            size_t first = ( std::min )( count, N - index );
+
+            std::copy( m_data + index, m_data + index + first, data );
+            std::copy( m_data, m_data + ( count - first ), data + first );
+        }
+
+        m_head += count;
+    }
+
+    void storage_clear()
+    {
+        m_head = m_tail;
+    }
+
+    friend class fixed_mt_circular_buffer_tests;
+
+    byte                                    m_data[N];
+    size_t                                  m_head;         // total bytes removed from m_data
+    size_t                                  m_tail;         // total bytes added to m_data
+};
@@ -1,5 +1,8 @@
+#include <deque>
 #include <future>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 #include <cppunit/extensions/HelperMacros.h>
 #include <cppunit/TestAssert.h>
@@ -14,6 +17,68 @@
 
 using namespace std;
 
+#ifdef MT_CIRCULAR_BUFFER_COROUTINES
+// fire and forget coroutine, runs until its first suspension when called
+// handle is only valid while the coroutine is suspended
+struct async_task
+{
+    struct promise_type
+    {
+        async_task get_return_object() { return async_task{ std::coroutine_handle<promise_type>::from_promise( *this ) }; }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<> handle;
+};
+
+// queues resumed coroutines so the test can run them on its own thread
+struct queue_scheduler
+{
+    std::deque<std::coroutine_handle<>>* queue;
+
+    void operator()( std::coroutine_handle<> handle ) const
+    {
+        queue->push_back( handle );
+    }
+};
+
+static void run_queue( std::deque<std::coroutine_handle<>>& queue )
+{
+    while( ! queue.empty() )
+    {
+        std::coroutine_handle<> handle = queue.front();
+        queue.pop_front();
+        handle.resume();
+    }
+}
+
+static async_task async_reader( mt_circular_buffer* cb, char* output, size_t count, queue_scheduler scheduler, size_t* result )
+{
+    *result = co_await cb->async_read( output, count, scheduler );
+}
+
+static async_task async_writer( mt_circular_buffer* cb, const char* input, size_t count, queue_scheduler scheduler, bool* threw )
+{
+    try
+    {
+        co_await cb->async_write( input, count, scheduler );
+    }
+    catch( std::runtime_error& )
+    {
+        *threw = true;
+    }
+}
+
+static async_task async_waiter( mt_circular_buffer* cb, queue_scheduler scheduler, bool* woken )
+{
+    co_await cb->async_wait_for_write( scheduler );
+    *woken = true;
+}
+#endif
+
 class mt_circular_buffer_tests : public CPPUNIT_NS::TestFixture
 {
 public:
@@ -375,11 +440,13 @@ public:
         cb->write( input.data(), input.size() );
         
         cb->skip(1);
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, cb->skip(0) );
 
         char b;
         cb->read( &b, 1 );
 
         CPPUNIT_ASSERT_EQUAL( '2', b );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )2, cb->total_read() );
     }
 
     void test_skip2()
@@ -401,6 +468,564 @@ public:
         CPPUNIT_ASSERT_EQUAL( '6', b );
     }
 
+    void test_read_at_least1()
+    {
+        std::string input( "123" );
+        cb->write( input.data(), input.size() );
+
+        char output[4] = { 0 };
+        CPPUNIT_ASSERT_EQUAL( ( size_t )2, cb->read_at_least( output, 1, 2 ) );
+        CPPUNIT_ASSERT( std::string( "12" ) == output );
+
+        // min of 0 never blocks
+        CPPUNIT_ASSERT_EQUAL( ( size_t )1, cb->read_at_least( output, 0, 4 ) );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, cb->read_at_least( output, 0, 4 ) );
+    }
+
+    void test_read_at_least2()
+    {
+        std::string input( "12" );
+        cb->write( input.data(), input.size() );
+
+        // nobody is going to write the other bytes so we should time out with what's there
+        char output[4] = { 0 };
+        CPPUNIT_ASSERT_EQUAL( ( size_t )2, cb->read_at_least( output, 3, 4, boost::posix_time::milliseconds( 10 ) ) );
+        CPPUNIT_ASSERT( input == output );
+
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, cb->read_at_least( output, 1, 4, boost::posix_time::milliseconds( 10 ) ) );
+    }
+
+    void test_read_at_least3()
+    {
+        // min is larger than the capacity so this has to be read in pieces
+        std::string input( "this is a really long string" );
+        char output[256];
+        output[ input.size() ] = 0; // we can either null terminate this string or read/write +1
+
+        auto async_writer = [&]()
+        {
+            cb->write( input.data(), input.size() );
+            cb->close();
+        };
+
+        std::future<void> writer = std::async( std::launch::async, async_writer );
+
+        size_t bytes_read = 0;
+        size_t n;
+
+        // each read needs several writes to satisfy min, the last one is cut short by close()
+        while( ( n = cb->read_at_least( output + bytes_read, 10, 255 - bytes_read ) ) > 0 )
+        {
+            CPPUNIT_ASSERT( n >= 10 || bytes_read + n == input.size() );
+            bytes_read += n;
+        }
+
+        writer.get();
+
+        CPPUNIT_ASSERT_EQUAL( input.size(), bytes_read );
+
+        logging << endl << input << endl << output << endl;
+        CPPUNIT_ASSERT( input == output );
+    }
+
+    void test_read_at_least4()
+    {
+        // bytes trickling in below min don't end the read early, the timeout does
+        cb.reset( new mt_circular_buffer( 64 ) );
+
+        auto async_writer = [&]()
+        {
+            for( char b = '1'; b <= '3'; ++b )
+            {
+                std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+                cb->write( &b, 1 );
+            }
+        };
+
+        std::future<void> writer = std::async( std::launch::async, async_writer );
+
+        char output[17] = { 0 };
+        CPPUNIT_ASSERT_EQUAL( ( size_t )3, cb->read_at_least( output, 8, 16, boost::posix_time::milliseconds( 200 ) ) );
+        CPPUNIT_ASSERT( std::string( "123" ) == output );
+
+        writer.get();
+    }
+
+    void test_watermark1()
+    {
+        cb.reset( new mt_circular_buffer( 64 ) );
+        cb->set_read_watermark( 32 );
+        cb->set_write_watermark( 32 );
+
+        CPPUNIT_ASSERT_EQUAL( ( size_t )32, cb->read_watermark() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )32, cb->write_watermark() );
+
+        // the watermarks are larger than the transfer, we must still wake up when the read can finish
+        auto async_writer = [&]()
+        {
+            char b = 1;
+            cb->write( &b, 1 );
+        };
+
+        std::future<void> writer = std::async( std::launch::async, async_writer );
+
+        char b = 0;
+        cb->read( &b, 1 );
+        writer.get();
+
+        CPPUNIT_ASSERT_EQUAL( char( 1 ), b );
+    }
+
+    void test_watermark2()
+    {
+        // watermarks larger than the capacity behave as if the buffer has to fill or drain
+        cb->set_read_watermark( 100 );
+        cb->set_write_watermark( 100 );
+        test_writing4();
+        test_reading3();
+    }
+
+    // write input while reading it back chunk bytes at a time
+    void mismatched_chunks( size_t chunk )
+    {
+        std::string input;
+        for( int i = 0; i < 340; ++i )
+        {
+            input += char( 'a' + i % 26 );
+        }
+
+        std::string output( input.size(), 0 );
+
+        auto async_writer = [&]()
+        {
+            cb->write( input.data(), input.size() );
+        };
+
+        std::future<void> writer = std::async( std::launch::async, async_writer );
+
+        for( size_t bytes_read = 0; bytes_read < input.size(); bytes_read += chunk )
+        {
+            cb->read( &output[ bytes_read ], ( std::min )( chunk, input.size() - bytes_read ) );
+        }
+
+        writer.get();
+        CPPUNIT_ASSERT( input == output );
+    }
+
+    void test_watermark3()
+    {
+        // the reader and writer disagree on chunk sizes, they must never both wait for the other
+        cb->set_read_watermark( 100 );
+        cb->set_write_watermark( 100 );
+        mismatched_chunks( 3 );
+
+        cb.reset( new mt_circular_buffer( 64 ) );
+        cb->set_read_watermark( 48 );
+        cb->set_write_watermark( 48 );
+        mismatched_chunks( 34 );
+    }
+
+    void test_watermark4()
+    {
+        // a blocked reader is left alone until the read watermark is reached
+        cb.reset( new mt_circular_buffer( 64 ) );
+        cb->set_read_watermark( 8 );
+
+        std::string input( "12345678" );
+        char output[9] = { 0 };
+
+        auto async_reader = [&]()
+        {
+            cb->read( output, 8 );
+        };
+
+        std::future<void> reader = std::async( std::launch::async, async_reader );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+
+        cb->write( input.data(), 4 );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+
+        // with a watermark of 1 the reader would have taken these already
+        CPPUNIT_ASSERT_EQUAL( ( size_t )4, cb->size() );
+
+        cb->write( input.data() + 4, 4 );
+        reader.get();
+
+        CPPUNIT_ASSERT( input == output );
+        CPPUNIT_ASSERT_EQUAL( true, cb->empty() );
+    }
+
+    void test_watermark5()
+    {
+        // readers waiting for different amounts, each must be woken once it can finish
+        cb.reset( new mt_circular_buffer( 1024 ) );
+        cb->set_read_watermark( 1000 );
+
+        std::string input( 1010, 'x' );
+        char small[10];
+        std::vector<char> large( 1000 );
+
+        // make sure the first write has happened so it doesn't wake everybody
+        cb->write( input.data(), 1 );
+        cb->read( small, 1 );
+
+        std::future<size_t> reader_small = std::async( std::launch::async, [&]() { return cb->read( small, 10 ); } );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+
+        std::future<size_t> reader_large = std::async( std::launch::async, [&]() { return cb->read( &large[0], 1000 ); } );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+
+        cb->write( input.data(), 10 );
+
+        bool woken = reader_small.wait_for( std::chrono::seconds( 5 ) ) == std::future_status::ready;
+        if( ! woken ) { cb->close(); } // don't hang the test
+
+        CPPUNIT_ASSERT( woken );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )10, reader_small.get() );
+
+        cb->write( input.data(), 1000 );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )1000, reader_large.get() );
+        CPPUNIT_ASSERT_EQUAL( true, cb->empty() );
+    }
+
+    void test_watermark6()
+    {
+        // writers waiting for different amounts of room, each must be woken once it can finish
+        cb.reset( new mt_circular_buffer( 64 ) );
+        cb->set_write_watermark( 48 );
+
+        std::string full( 64, 'x' );
+        std::string large( 60, 'a' );
+        std::string small( 4, 'b' );
+
+        cb->write( full.data(), full.size() );
+
+        std::future<size_t> writer_large = std::async( std::launch::async, [&]() { return cb->write( large.data(), large.size() ); } );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+
+        std::future<size_t> writer_small = std::async( std::launch::async, [&]() { return cb->write( small.data(), small.size() ); } );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+
+        char output[128];
+        cb->read( output, 4 );
+
+        bool woken = writer_small.wait_for( std::chrono::seconds( 5 ) ) == std::future_status::ready;
+        if( ! woken ) // don't hang the test, drain the buffer until both writers are done
+        {
+            while( cb->read_at_least( output, 1, sizeof( output ), boost::posix_time::milliseconds( 100 ) ) > 0 ) {}
+        }
+
+        CPPUNIT_ASSERT( woken );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )4, writer_small.get() );
+
+        cb->read( output, 124 );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )60, writer_large.get() );
+
+        CPPUNIT_ASSERT( full.substr( 4 ) + small + large == std::string( output, 124 ) );
+    }
+
+    void test_pool1()
+    {
+        mt_block_pool::pointer pool( new mt_block_pool( 2 ) );
+        cb.reset( new mt_circular_buffer( 4, pool ) );
+
+        // nothing is allocated until we write
+        CPPUNIT_ASSERT_EQUAL( ( size_t )4, cb->capacity() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, pool->blocks_in_use() );
+
+        std::string input( "123" );
+        cb->write( input.data(), input.size() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )3, cb->size() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )2, pool->blocks_in_use() );
+
+        char b;
+        cb->read( &b, 1 );
+        CPPUNIT_ASSERT_EQUAL( '1', b );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )2, pool->blocks_in_use() );
+
+        // a block is given back as soon as it's been read
+        cb->read( &b, 1 );
+        CPPUNIT_ASSERT_EQUAL( '2', b );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )1, pool->blocks_in_use() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )1, pool->blocks_free() );
+
+        // and a drained buffer holds nothing
+        cb->read( &b, 1 );
+        CPPUNIT_ASSERT_EQUAL( '3', b );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, pool->blocks_in_use() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )2, pool->blocks_free() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )2, pool->peak_blocks_in_use() );
+        CPPUNIT_ASSERT_EQUAL( true, cb->empty() );
+    }
+
+    void test_pool2()
+    {
+        mt_block_pool::pointer pool( new mt_block_pool( 3, 1 ) );
+        cb.reset( new mt_circular_buffer( 4, pool ) );
+
+        std::string input( "1234" );
+        cb->write( input.data(), input.size() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )2, pool->blocks_in_use() );
+
+        cb->set_capacity( 1 ); // like the unpooled buffer, keeps the front of the buffer
+        CPPUNIT_ASSERT_EQUAL( ( size_t )1, pool->blocks_in_use() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )1, pool->blocks_free() );
+
+        char b;
+        cb->read( &b, 1 );
+        CPPUNIT_ASSERT_EQUAL( '1', b );
+
+        // max_free is 1 so the second block was deleted
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, pool->blocks_in_use() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )1, pool->blocks_free() );
+
+        cb->write( input.data(), 1 );
+        cb.reset(); // blocks are returned when the buffer is destroyed
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, pool->blocks_in_use() );
+    }
+
+    void test_pool3()
+    {
+        // block size doesn't evenly divide the capacity and data keeps wrapping across blocks
+        mt_block_pool::pointer pool( new mt_block_pool( 3 ) );
+
+        cb.reset( new mt_circular_buffer( 4, pool ) );
+        test_writing4();
+
+        cb.reset( new mt_circular_buffer( 4, pool ) );
+        test_reading3();
+
+        cb.reset( new mt_circular_buffer( 4, pool ) );
+        test_close1();
+
+        cb.reset( new mt_circular_buffer( 4, pool ) );
+        test_skip2();
+
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, pool->blocks_in_use() );
+    }
+
+    void test_pool4()
+    {
+        CPPUNIT_ASSERT_THROW( mt_block_pool( 0 ), std::invalid_argument );
+        CPPUNIT_ASSERT_THROW( mt_circular_buffer( 4, mt_block_pool::pointer() ), std::invalid_argument );
+    }
+
+    void test_pool5()
+    {
+        // blocks acquired on one thread and released on another get back to the pool for everyone
+        mt_block_pool::pointer pool( new mt_block_pool( 16 ) );
+        std::vector<mt_block_pool::byte*> blocks;
+        const size_t n = 4 * mt_block_pool::thread_cache_size;
+
+        std::thread acquirer( [&]() { for( size_t i = 0; i < n; ++i ) { blocks.push_back( pool->acquire() ); } } );
+        acquirer.join();
+
+        CPPUNIT_ASSERT_EQUAL( n, pool->blocks_in_use() );
+        CPPUNIT_ASSERT_EQUAL( n, pool->blocks_allocated() );
+
+        // the releasing thread's cache is handed back when it exits
+        std::thread releaser( [&]() { for( size_t i = 0; i < n; ++i ) { pool->release( blocks[i] ); } } );
+        releaser.join();
+
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, pool->blocks_in_use() );
+        CPPUNIT_ASSERT_EQUAL( n, pool->blocks_free() );
+
+        std::thread reuser( [&]() { for( size_t i = 0; i < n; ++i ) { blocks[i] = pool->acquire(); } } );
+        reuser.join();
+
+        CPPUNIT_ASSERT_EQUAL( n, pool->blocks_in_use() );
+        CPPUNIT_ASSERT_EQUAL( n, pool->blocks_allocated() ); // nothing new was allocated
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, pool->blocks_free() );
+
+        for( size_t i = 0; i < n; ++i )
+        {
+            pool->release( blocks[i] );
+        }
+
+        CPPUNIT_ASSERT_EQUAL( n, pool->blocks_free() );
+    }
+
+    void test_pool6()
+    {
+        // a pool can go away while this thread still has some of its blocks cached
+        mt_block_pool::pointer pool( new mt_block_pool( 16 ) );
+        pool->release( pool->acquire() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )1, pool->blocks_free() );
+        pool.reset();
+
+        // using another pool forgets the dead one and deletes its blocks
+        pool.reset( new mt_block_pool( 16 ) );
+        pool->release( pool->acquire() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )1, pool->blocks_allocated() );
+    }
+
+#ifdef MT_CIRCULAR_BUFFER_COROUTINES
+    void test_async_read()
+    {
+        std::deque<std::coroutine_handle<>> queue;
+        queue_scheduler scheduler = { &queue };
+
+        std::string input( "this is a really long string" );
+        char output[256] = { 0 };
+        size_t result = 0;
+
+        async_reader( cb.get(), output, input.size(), scheduler, &result );
+        CPPUNIT_ASSERT( queue.empty() ); // nothing to read yet so we're suspended
+
+        // no other thread is reading but the suspended coroutine drains the buffer as we write
+        cb->write( input.data(), input.size() );
+
+        CPPUNIT_ASSERT_EQUAL( ( size_t )1, queue.size() );
+        run_queue( queue );
+
+        CPPUNIT_ASSERT_EQUAL( input.size(), result );
+        CPPUNIT_ASSERT( input == output );
+    }
+
+    void test_async_write()
+    {
+        std::deque<std::coroutine_handle<>> queue;
+        queue_scheduler scheduler = { &queue };
+
+        std::string input( "this is a really long string" );
+        char output[256] = { 0 };
+        bool threw = false;
+
+        async_writer( cb.get(), input.data(), input.size(), scheduler, &threw );
+        CPPUNIT_ASSERT_EQUAL( true, cb->full() );
+
+        cb->read( output, input.size() );
+        run_queue( queue );
+
+        CPPUNIT_ASSERT_EQUAL( false, threw );
+        CPPUNIT_ASSERT( input == output );
+    }
+
+    void test_async_close()
+    {
+        std::deque<std::coroutine_handle<>> queue;
+        queue_scheduler scheduler = { &queue };
+
+        char output[256] = { 0 };
+        size_t result = 0;
+        bool woken = false;
+
+        async_waiter( cb.get(), scheduler, &woken );
+        async_reader( cb.get(), output, 10, scheduler, &result );
+
+        cb->write( "12", 2 );
+        cb->close();
+        run_queue( queue );
+
+        CPPUNIT_ASSERT_EQUAL( true, woken );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )2, result );
+        CPPUNIT_ASSERT( std::string( "12" ) == output );
+
+        bool threw = false;
+        async_writer( cb.get(), "1", 1, scheduler, &threw );
+        CPPUNIT_ASSERT_EQUAL( true, threw );
+    }
+
+    void test_async_both()
+    {
+        // an async reader and an async writer with no threads blocked at all
+        std::deque<std::coroutine_handle<>> queue;
+        queue_scheduler scheduler = { &queue };
+
+        std::string input( "this is a really long string" );
+        char output[256] = { 0 };
+        size_t result = 0;
+        bool threw = false;
+
+        async_reader( cb.get(), output, input.size(), scheduler, &result );
+        async_writer( cb.get(), input.data(), input.size(), scheduler, &threw );
+        run_queue( queue );
+
+        CPPUNIT_ASSERT_EQUAL( false, threw );
+        CPPUNIT_ASSERT_EQUAL( input.size(), result );
+        CPPUNIT_ASSERT( input == output );
+        CPPUNIT_ASSERT_EQUAL( true, cb->empty() );
+    }
+
+    void test_async_threads()
+    {
+        // the async reader is completed by another thread's blocking writes
+        std::deque<std::coroutine_handle<>> queue;
+        queue_scheduler scheduler = { &queue };
+
+        std::string input( "this is a really long string" );
+        char output[256] = { 0 };
+        size_t result = 0;
+
+        async_reader( cb.get(), output, input.size(), scheduler, &result );
+
+        auto writer = [&]()
+        {
+            cb->write( input.data(), input.size() );
+        };
+
+        std::async( std::launch::async, writer ).get();
+        run_queue( queue );
+
+        CPPUNIT_ASSERT_EQUAL( input.size(), result );
+        CPPUNIT_ASSERT( input == output );
+    }
+
+    void test_async_cancel()
+    {
+        std::deque<std::coroutine_handle<>> queue;
+        queue_scheduler scheduler = { &queue };
+
+        char output[256] = { 0 };
+        size_t result = 0;
+        bool threw = false;
+
+        // destroying the suspended coroutines takes their operations out of the buffer
+        async_reader( cb.get(), output, 10, scheduler, &result ).handle.destroy();
+
+        std::string input( "123456" );
+        async_writer( cb.get(), input.data(), input.size(), scheduler, &threw ).handle.destroy();
+
+        CPPUNIT_ASSERT_EQUAL( ( size_t )4, cb->size() );
+
+        char b;
+        cb->read( &b, 1 );
+        cb->write( "5", 1 );
+        cb->close();
+
+        CPPUNIT_ASSERT( queue.empty() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, result );
+        CPPUNIT_ASSERT_EQUAL( '1', b );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )4, cb->size() );
+    }
+
+    void test_async_destroy()
+    {
+        // destroying the buffer completes pending operations like close() does
+        std::deque<std::coroutine_handle<>> queue;
+        queue_scheduler scheduler = { &queue };
+
+        char output[256] = { 0 };
+        size_t result = 1;
+        bool woken = false;
+
+        cb.reset( new mt_circular_buffer( 4 ) );
+        async_reader( cb.get(), output, 10, scheduler, &result );
+
+        mt_circular_buffer::pointer other( new mt_circular_buffer( 4 ) );
+        async_waiter( other.get(), scheduler, &woken );
+
+        cb.reset();
+        other.reset();
+
+        CPPUNIT_ASSERT_EQUAL( ( size_t )2, queue.size() );
+        run_queue( queue );
+
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, result );
+        CPPUNIT_ASSERT_EQUAL( true, woken );
+    }
+#endif
+
     CPPUNIT_TEST_SUITE( mt_circular_buffer_tests );
     CPPUNIT_TEST( test_size );
     CPPUNIT_TEST( test_clear );
@@ -423,11 +1048,200 @@ public:
     CPPUNIT_TEST( test_reading3 );
     CPPUNIT_TEST( test_skip1 );
     CPPUNIT_TEST( test_skip2 );
+    CPPUNIT_TEST( test_read_at_least1 );
+    CPPUNIT_TEST( test_read_at_least2 );
+    CPPUNIT_TEST( test_read_at_least3 );
+    CPPUNIT_TEST( test_read_at_least4 );
+    CPPUNIT_TEST( test_watermark1 );
+    CPPUNIT_TEST( test_watermark2 );
+    CPPUNIT_TEST( test_watermark3 );
+    CPPUNIT_TEST( test_watermark4 );
+    CPPUNIT_TEST( test_watermark5 );
+    CPPUNIT_TEST( test_watermark6 );
+    CPPUNIT_TEST( test_pool1 );
+    CPPUNIT_TEST( test_pool2 );
+    CPPUNIT_TEST( test_pool3 );
+    CPPUNIT_TEST( test_pool4 );
+    CPPUNIT_TEST( test_pool5 );
+    CPPUNIT_TEST( test_pool6 );
+#ifdef MT_CIRCULAR_BUFFER_COROUTINES
+    CPPUNIT_TEST( test_async_read );
+    CPPUNIT_TEST( test_async_write );
+    CPPUNIT_TEST( test_async_close );
+    CPPUNIT_TEST( test_async_both );
+    CPPUNIT_TEST( test_async_threads );
+    CPPUNIT_TEST( test_async_cancel );
+    CPPUNIT_TEST( test_async_destroy );
+#endif
     CPPUNIT_TEST_SUITE_END();
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION( mt_circular_buffer_tests );
 
+class fixed_mt_circular_buffer_tests : public CPPUNIT_NS::TestFixture
+{
+public:
+
+    typedef fixed_mt_circular_buffer<4> buffer_type;
+    buffer_type::pointer cb;
+    typedef buffer_type::byte byte;
+
+    void setUp()
+    {
+        cb.reset( new buffer_type() );
+        CPPUNIT_ASSERT( cb );
+        logging << endl;
+    }
+
+    void tearDown()
+    {
+        cb.reset();
+    }
+
+    void test_size()
+    {
+        static_assert( buffer_type::capacity() == 4, "capacity should be a compile time constant" );
+
+        CPPUNIT_ASSERT_EQUAL( ( size_t )4, cb->capacity() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, cb->size() );
+        CPPUNIT_ASSERT_EQUAL( true, cb->empty() );
+        CPPUNIT_ASSERT_EQUAL( false, cb->full() );
+    }
+
+    void test_clear()
+    {
+        byte b = 0;
+        cb->write( &b, 1 );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )1, cb->size() );
+
+        cb->clear();
+
+        CPPUNIT_ASSERT_EQUAL( true, cb->empty() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, cb->size() );
+    }
+
+    void test_close()
+    {
+        cb->close();
+
+        byte b = 0;
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, cb->read(&b,1) );
+
+        CPPUNIT_ASSERT_THROW( cb->write(&b,1), std::runtime_error );
+    }
+
+    void test_wrapping()
+    {
+        // push the head and tail around the end of the storage a few times
+        std::string input( "123" );
+        char output[4] = { 0 };
+
+        for( int i = 0; i < 5; ++i )
+        {
+            cb->write( input.data(), input.size() );
+            CPPUNIT_ASSERT_EQUAL( ( size_t )3, cb->size() );
+
+            cb->read( output, input.size() );
+            CPPUNIT_ASSERT( input == output );
+            CPPUNIT_ASSERT_EQUAL( true, cb->empty() );
+        }
+
+        CPPUNIT_ASSERT_EQUAL( ( size_t )15, cb->total_read() );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )15, cb->total_written() );
+    }
+
+    void test_writing()
+    {
+        std::string input( "this is a really long string" );
+        char output[256];
+        output[ input.size() ] = 0; // we can either null terminate this string or read/write +1
+
+        auto async_reader = [&]()
+        {
+            cb->read( output, input.size() );
+        };
+
+        std::future<void> reader = std::async( std::launch::async, async_reader );
+
+        cb->write( input.data(), input.size() );
+        reader.get();
+
+        logging << endl << input << endl << output << endl;
+        CPPUNIT_ASSERT( input == output );
+    }
+
+    void test_skip()
+    {
+        std::string input( "123456" );
+
+        auto async_writer = [&]()
+        {
+            cb->write( input.data(), input.size() );
+        };
+
+        std::future<void> writer = std::async( std::launch::async, async_writer );
+
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, cb->skip(0) );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )5, cb->skip(5) );
+
+        char b;
+        cb->read( &b, 1 );
+
+        CPPUNIT_ASSERT_EQUAL( '6', b );
+        CPPUNIT_ASSERT_EQUAL( ( size_t )6, cb->total_read() );
+    }
+
+    void test_read_at_least()
+    {
+        std::string input( "123" );
+        cb->write( input.data(), input.size() );
+
+        char output[4] = { 0 };
+        CPPUNIT_ASSERT_EQUAL( ( size_t )3, cb->read_at_least( output, 1, 4 ) );
+        CPPUNIT_ASSERT( input == output );
+
+        CPPUNIT_ASSERT_EQUAL( ( size_t )0, cb->read_at_least( output, 1, 4, boost::posix_time::milliseconds( 10 ) ) );
+    }
+
+    void test_watermark()
+    {
+        // watermarks larger than the capacity with the reader's chunks not matching the writer's
+        cb->set_read_watermark( 100 );
+        cb->set_write_watermark( 100 );
+
+        std::string input( "this is a really long string" );
+        std::string output( input.size(), 0 );
+
+        auto async_writer = [&]()
+        {
+            cb->write( input.data(), input.size() );
+        };
+
+        std::future<void> writer = std::async( std::launch::async, async_writer );
+
+        for( size_t bytes_read = 0; bytes_read < input.size(); bytes_read += 3 )
+        {
+            cb->read( &output[ bytes_read ], ( std::min )( size_t( 3 ), input.size() - bytes_read ) );
+        }
+
+        writer.get();
+        CPPUNIT_ASSERT( input == output );
+    }
+
+    CPPUNIT_TEST_SUITE( fixed_mt_circular_buffer_tests );
+    CPPUNIT_TEST( test_size );
+    CPPUNIT_TEST( test_clear );
+    CPPUNIT_TEST( test_close );
+    CPPUNIT_TEST( test_wrapping );
+    CPPUNIT_TEST( test_writing );
+    CPPUNIT_TEST( test_skip );
+    CPPUNIT_TEST( test_read_at_least );
+    CPPUNIT_TEST( test_watermark );
+    CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( fixed_mt_circular_buffer_tests );
+
 int main( int argc, char** argv )
 {
     // informs test-listener about testresults